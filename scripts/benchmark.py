@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+#
+# Copyright 2019 Google LLC
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     https://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Runs site/benchmark.html in headless Chrome and prints the JSON report."""
+import argparse
+import functools
+import http.server
+import os
+import queue
+import shutil
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+import urllib.parse
+
+SITE_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'site')
+REPORT_PATH = '/report'
+
+
+class Handler(http.server.SimpleHTTPRequestHandler):
+
+  def end_headers(self):
+    # Cross-origin isolation is required for SharedArrayBuffer (pthreads).
+    self.send_header('Cross-Origin-Opener-Policy', 'same-origin')
+    self.send_header('Cross-Origin-Embedder-Policy', 'require-corp')
+    super().end_headers()
+
+  def do_POST(self):
+    if self.path != REPORT_PATH:
+      self.send_error(404)
+      return
+    length = int(self.headers['Content-Length'])
+    self.server.reports.put(self.rfile.read(length).decode('utf-8'))
+    self.send_response(204)
+    self.end_headers()
+
+  def log_message(self, format, *args):
+    pass
+
+
+def find_chrome():
+  for name in ('google-chrome', 'google-chrome-stable', 'chromium',
+               'chromium-browser'):
+    path = shutil.which(name)
+    if path:
+      return path
+  return None
+
+
+def wait_for_report(reports, chrome, timeout):
+  """Waits for the POSTed report, failing early if Chrome exits without one."""
+  deadline = time.monotonic() + timeout
+  while True:
+    try:
+      return reports.get(timeout=1)
+    except queue.Empty:
+      pass
+    if chrome.poll() is not None:
+      try:
+        return reports.get_nowait()  # Posted right before exiting.
+      except queue.Empty:
+        sys.exit('Chrome exited with code %d before reporting' %
+                 chrome.returncode)
+    if time.monotonic() > deadline:
+      sys.exit('Benchmark timed out')
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__)
+  parser.add_argument('--chrome', default=find_chrome(),
+                      help='Chrome executable')
+  parser.add_argument('--models', default='',
+                      help='comma separated TFLITE_MODELS keys (default: all)')
+  parser.add_argument('--device', default='cpu', choices=['cpu', 'tpu', ''],
+                      help='only run models for this device')
+  parser.add_argument('--warmup', type=int, default=5)
+  parser.add_argument('--iterations', type=int, default=50)
+  parser.add_argument('--wasm', default='',
+                      help='force wasm variant (baseline, simd)')
+  parser.add_argument('--track', default='',
+                      help='K[,motion]: track detections, detecting every K frames')
+  parser.add_argument('--mock-dfu', action='store_true',
+                      help='flash a fake DFU device and report flash time')
+  parser.add_argument('--port', type=int, default=8001)
+  parser.add_argument('--timeout', type=int, default=600, help='seconds')
+  parser.add_argument('--output', help='write JSON here instead of stdout')
+  args = parser.parse_args()
+
+  if not args.chrome:
+    sys.exit('Chrome not found, use --chrome')
+
+  handler = functools.partial(Handler, directory=SITE_DIR)
+  server = http.server.ThreadingHTTPServer(('localhost', args.port), handler)
+  server.reports = queue.Queue()
+  threading.Thread(target=server.serve_forever, daemon=True).start()
+
+  query = {
+      'warmup': args.warmup,
+      'iterations': args.iterations,
+      'report': REPORT_PATH,
+  }
+  for key in ('models', 'device', 'wasm', 'track'):
+    if getattr(args, key):
+      query[key] = getattr(args, key)
+  if args.mock_dfu:
+    query['mock'] = 'dfu'
+    query['flash'] = 1
+  url = 'http://localhost:%d/benchmark.html?%s' % (
+      args.port, urllib.parse.urlencode(query))
+
+  with tempfile.TemporaryDirectory() as profile:
+    chrome = subprocess.Popen([
+        args.chrome, '--headless=new', '--no-first-run',
+        '--user-data-dir=' + profile, '--remote-debugging-port=0', url
+    ], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    try:
+      report = wait_for_report(server.reports, chrome, args.timeout)
+    finally:
+      chrome.terminate()
+      chrome.wait()
+      server.shutdown()
+
+  if args.output:
+    with open(args.output, 'w') as f:
+      f.write(report)
+  else:
+    print(report)
+
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,180 @@
+/**
+ * @license
+ * Copyright 2021 Google LLC. All Rights Reserved.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * =============================================================================
+ */
+
+// Fake navigator.usb with a USB Accelerator in DFU mode (1a6e:089a), to
+// measure firmware flashing in tflite/libusb.cc without hardware. The device
+// detaches during manifestation and re-enumerates as 18d1:9302 after
+// `reenumerateMs`; it is only listed by getDevices() if `permitFlashed`.
+const mockDfu = {};
+
+(function() {
+  'use strict';
+
+  const DFU_IDS = {'vendorId': 0x1a6e, 'productId': 0x089a};
+  const FLASHED_IDS = {'vendorId': 0x18d1, 'productId': 0x9302};
+
+  // USB Device Firmware Upgrade 1.1 requests and states.
+  const GET_DESCRIPTOR = 6;
+  const DFU_DNLOAD = 1;
+  const DFU_GETSTATUS = 3;
+  const DFU_CLRSTATUS = 4;
+  const DFU_IDLE = 2;
+  const DFU_DNLOAD_SYNC = 3;
+  const DFU_DNBUSY = 4;
+  const DFU_DNLOAD_IDLE = 5;
+  const DFU_MANIFEST_SYNC = 6;
+  const DFU_MANIFEST = 7;
+
+  const sleep = ms => new Promise(resolve => setTimeout(resolve, ms));
+
+  function MockDevice(ids, options) {
+    Object.assign(this, ids);
+    this.options = options;
+    this.usbVersionMajor = 2;
+    this.usbVersionMinor = 0;
+    this.deviceClass = 0;
+    this.deviceSubClass = 0;
+    this.deviceProtocol = 0;
+    this.deviceVersionMajor = 1;
+    this.deviceVersionMinor = 0;
+    this.deviceVersionSubminor = 0;
+    this.configurations = [{'configurationValue': 1}];
+    this.configuration = null;
+    this.state = DFU_IDLE;
+    this.bytes = 0;
+    this.detached = false;
+  }
+
+  MockDevice.prototype.check = async function() {
+    await sleep(this.options.latencyMs);
+    if (this.detached)
+      throw new DOMException('Device detached', 'NetworkError');
+  }
+
+  MockDevice.prototype.open = async function() { await this.check(); }
+  MockDevice.prototype.close = async function() { await this.check(); }
+  MockDevice.prototype.reset = async function() { await this.check(); }
+  MockDevice.prototype.claimInterface = async function() { await this.check(); }
+  MockDevice.prototype.releaseInterface = async function() { await this.check(); }
+
+  MockDevice.prototype.selectConfiguration = async function(value) {
+    await this.check();
+    this.configuration = this.configurations[0];
+  }
+
+  // Configuration, DFU interface and DFU functional descriptors.
+  MockDevice.prototype.configDescriptor = function() {
+    const size = this.options.transferSize;
+    return new Uint8Array([
+      9, 2, 27, 0, 1, 1, 0, 0x80, 50,
+      9, 4, 0, 0, 0, 0xfe, 1, 2, 0,
+      9, 0x21, 0x09, 0xff, 0, size & 0xff, size >> 8, 0x10, 0x01,
+    ]);
+  }
+
+  MockDevice.prototype.getStatus = function() {
+    let pollTimeout = 0;
+    switch (this.state) {
+      case DFU_DNLOAD_SYNC:
+        this.state = DFU_DNBUSY;
+        pollTimeout = this.options.blockMs;
+        break;
+      case DFU_DNBUSY:
+        this.state = DFU_DNLOAD_IDLE;
+        break;
+      case DFU_MANIFEST_SYNC:
+        this.state = DFU_MANIFEST;
+        pollTimeout = this.options.manifestMs;
+        break;
+      case DFU_MANIFEST:
+        this.detach();
+        throw new DOMException('Device detached', 'NetworkError');
+    }
+    return new Uint8Array([0, pollTimeout & 0xff, (pollTimeout >> 8) & 0xff,
+                           pollTimeout >> 16, this.state, 0]);
+  }
+
+  MockDevice.prototype.detach = function() {
+    this.detached = true;
+    mockDfu.devices = [];
+    mockDfu.flashedBytes = this.bytes;
+    setTimeout(() => {
+      mockDfu.devices = [new MockDevice(FLASHED_IDS, this.options)];
+    }, this.options.reenumerateMs);
+  }
+
+  MockDevice.prototype.controlTransferIn = async function(setup, length) {
+    await this.check();
+    let data;
+    if (setup.requestType == 'standard' && setup.request == GET_DESCRIPTOR)
+      data = this.configDescriptor();
+    else if (setup.requestType == 'class' && setup.request == DFU_GETSTATUS)
+      data = this.getStatus();
+    else
+      return {'status': 'stall'};
+    data = data.slice(0, length);
+    return {'status': 'ok', 'data': new DataView(data.buffer)};
+  }
+
+  MockDevice.prototype.controlTransferOut = async function(setup, data) {
+    await this.check();
+    const length = data ? data.byteLength : 0;
+    switch (setup.request) {
+      case DFU_DNLOAD:
+        this.bytes += length;
+        this.state = length ? DFU_DNLOAD_SYNC : DFU_MANIFEST_SYNC;
+        break;
+      case DFU_CLRSTATUS:
+        this.state = DFU_IDLE;
+        break;
+      default:
+        return {'status': 'stall', 'bytesWritten': 0};
+    }
+    return {'status': 'ok', 'bytesWritten': length};
+  }
+
+  const matches = (device, filters) => filters.some(
+      f => f.vendorId == device.vendorId && f.productId == device.productId);
+
+  // Replaces navigator.usb; call again to start over from DFU mode.
+  mockDfu.install = function(options={}) {
+    options = Object.assign({
+      'transferSize': 256,
+      'latencyMs': 0,
+      'blockMs': 1,
+      'manifestMs': 10,
+      'reenumerateMs': 100,
+      'permitFlashed': true,
+    }, options);
+
+    mockDfu.devices = [new MockDevice(DFU_IDS, options)];
+    mockDfu.flashedBytes = 0;
+    Object.defineProperty(navigator, 'usb', {
+      'configurable': true,
+      'value': {
+        'getDevices': async () => mockDfu.devices.filter(
+            d => d.productId == DFU_IDS.productId || options.permitFlashed),
+        'requestDevice': async request => {
+          const device = mockDfu.devices.find(d => matches(d, request.filters));
+          if (!device)
+            throw new DOMException('No device selected.', 'NotFoundError');
+          return device;
+        },
+      },
+    });
+  }
+})();
@@ -20,38 +20,288 @@ const tflite = {};
   'use strict';
 
   let nextId = 0;
+  let completionRing = 0;
+  const pendingInvokes = new Map();
+
+  // At most ring capacity invokes are in flight, so interpreter threads never
+  // wait for ring space while the main thread is blocked (e.g. in destroy()).
+  let outstandingInvokes = 0;
+  const waitingInvokes = [];
+
+  // TfLiteType values, see tensorflow/lite/c/common.h.
+  const TENSOR_TYPES = {
+    1: 'float32', 2: 'int32', 3: 'uint8', 4: 'int64', 6: 'bool', 7: 'int16',
+    9: 'int8',
+  };
+
+  // Must match TensorField in tflite/interpreter.cc.
+  const DESCRIPTOR_WORDS = 8;
+
+  function readTensorDescriptors(table) {
+    const words = Module.HEAP32;
+    const floats = Module.HEAPF32;
+    const base = table / words.BYTES_PER_ELEMENT;
+    const numInputs = words[base];
+    const numOutputs = words[base + 1];
+
+    const tensors = [];
+    for (let i = 0; i < numInputs + numOutputs; ++i) {
+      const d = base + 2 + DESCRIPTOR_WORDS * i;
+      const dims = base + words[d + 6];
+      tensors.push({
+        'type': TENSOR_TYPES[words[d]] || 'unknown',
+        'bytes': words[d + 1],
+        'buffer': words[d + 2] >>> 0,
+        'scale': floats[d + 3],
+        'zeroPoint': words[d + 4],
+        'shape': Array.from(words.subarray(dims, dims + words[d + 5])),
+        'name': UTF8ToString(table + words[d + 7]),
+      });
+    }
+    return [tensors.slice(0, numInputs), tensors.slice(numInputs)];
+  }
+
+  // Must match PostProcessType, PrimitiveField, kResultSlots and InvokeResult
+  // in tflite/interpreter.cc.
+  const POSTPROCESS_TYPES = {'none': 0, 'classification': 1, 'detection': 2};
+  const PRIMITIVE_WORDS = 8;
+  const PRIMITIVE_BOX = 1;
+  const RESULT_FRAMES = 4;
+  const INVOKE_SLOT = 2;
+
+  // Returns a typed array view of the tensor data in the wasm heap.
+  function tensorArray(tensor) {
+    switch (tensor.type) {
+      case 'uint8':
+        return Module.HEAPU8.subarray(tensor.buffer, tensor.buffer + tensor.bytes);
+      case 'int8':
+        return Module.HEAP8.subarray(tensor.buffer, tensor.buffer + tensor.bytes);
+      case 'float32':
+        return Module.HEAPF32.subarray(tensor.buffer / 4,
+                                       (tensor.buffer + tensor.bytes) / 4);
+    }
+    throw new Error(`Unsupported tensor type: ${tensor.type}`);
+  }
+
+  // uint8 pixels map to int8 inputs by flipping the sign bit (v - 128).
+  function pixelSignFlip(tensor) {
+    switch (tensor.type) {
+      case 'uint8': return 0x00;
+      case 'int8':  return 0x80;
+    }
+    throw new Error(`Unsupported input tensor type: ${tensor.type}`);
+  }
+
+  // Completions are pushed by interpreter threads into a ring in the shared
+  // heap (see tflite/completion_ring.h) and drained here in batches.
+  function ringCapacity() {
+    return Module.HEAP32[completionRing / Module.HEAP32.BYTES_PER_ELEMENT + 2];
+  }
+
+  function submitInvoke(interpreter, callback) {
+    if (outstandingInvokes >= ringCapacity()) {
+      waitingInvokes.push([interpreter, callback]);
+      return;
+    }
+    ++outstandingInvokes;
+    pendingInvokes.get(interpreter.id).push(callback);
+    interpreter.interpreter_invoke_async(interpreter.interpreter, interpreter.id);
+  }
+
+  function drainCompletions() {
+    const heap = Module.HEAP32;
+    const base = completionRing / heap.BYTES_PER_ELEMENT;
+    const head = Atomics.load(heap, base);
+    const mask = heap[base + 2] - 1;
+
+    const completed = [];
+    let tail = Atomics.load(heap, base + 1);
+    for (; tail != head; tail = (tail + 1) | 0) {
+      const entry = base + 3 + 2 * (tail & mask);
+      completed.push([heap[entry], heap[entry + 1]]);
+    }
+    Atomics.store(heap, base + 1, tail);
+    Atomics.notify(heap, base + 1);
+
+    outstandingInvokes -= completed.length;
+    for (const [id, result] of completed) {
+      const callbacks = pendingInvokes.get(id);
+      if (callbacks && callbacks.length) callbacks.shift().done(result);
+    }
+    while (waitingInvokes.length && outstandingInvokes < ringCapacity())
+      submitInvoke(...waitingInvokes.shift());
+    return head;
+  }
+
+  function watchCompletions() {
+    const head = drainCompletions();
+    if (!Atomics.waitAsync) {
+      setTimeout(watchCompletions, 1);
+      return;
+    }
 
-  function rgbaArrayToRgbArray(rgbaArray) {
-    const rgbArray = new Uint8Array(new ArrayBuffer(3 * rgbaArray.length / 4));
-    for (let i = 0, j = 0; i < rgbaArray.length; i += 4, j += 3) {
-      rgbArray[j + 0] = rgbaArray[i + 0];
-      rgbArray[j + 1] = rgbaArray[i + 1];
-      rgbArray[j + 2] = rgbaArray[i + 2];
+    const heap = Module.HEAP32;
+    const wait = Atomics.waitAsync(heap, completionRing / heap.BYTES_PER_ELEMENT, head);
+    if (wait.async)
+      wait.value.then(watchCompletions);
+    else
+      Promise.resolve().then(watchCompletions);
+  }
+
+  // Smallest module using an i8x16.splat (SIMD128).
+  const WASM_FEATURES = {
+    'simd': new Uint8Array([
+      0, 97, 115, 109, 1, 0, 0, 0, 1, 5, 1, 96, 0, 1, 123, 3, 2, 1, 0, 10, 10, 1,
+      8, 0, 65, 0, 253, 15, 253, 98, 11]),
+  };
+
+  // Variants supported by this browser, best first.
+  tflite.wasmVariants = function() {
+    const variants = Object.keys(WASM_FEATURES).filter(
+        variant => WebAssembly.validate(WASM_FEATURES[variant]));
+    return [...variants, 'baseline'];
+  }
+
+  // Resolves with `variant` once its wasm is instantiated.
+  function loadWasmVariant(module, variant) {
+    const dir = `wasm/${variant}/`;
+    const wasm = fetch(dir + 'interpreter.wasm');
+    module['wasmVariant'] = variant;
+    module['locateFile'] = path => dir + path;
+
+    return new Promise((resolve, reject) => {
+      module['instantiateWasm'] = (imports, receiveInstance) => {
+        WebAssembly.instantiateStreaming(wasm, imports)
+          .catch(error => {
+            // E.g. served without the application/wasm MIME type.
+            console.warn('instantiateStreaming', error);
+            return fetch(dir + 'interpreter.wasm').then(response => {
+              if (!response.ok)
+                throw new Error(`Cannot load ${response.url}: ${response.status}`);
+              return response.arrayBuffer();
+            }).then(bytes => WebAssembly.instantiate(bytes, imports));
+          })
+          .then(result => {
+            receiveInstance(result.instance, result.module);
+            resolve(variant);
+          })
+          .catch(error => {
+            console.error('instantiateWasm', error);
+            reject(error);
+          });
+        return {};
+      };
+      window.Module = module;
+
+      const script = document.createElement('script');
+      script.src = dir + 'interpreter.js';
+      script.onerror = () => {
+        script.remove();
+        reject(new Error(`Cannot load ${script.src}`));
+      };
+      document.head.appendChild(script);
+    });
+  }
+
+  // Loads the interpreter build from wasm/<variant>/ (see `make wasm`), by
+  // default the best supported one that was built and instantiates. A copy
+  // of `module` becomes the global emscripten Module; the .wasm download
+  // starts alongside interpreter.js and is compiled while it streams in.
+  tflite.loadWasm = async function(module={}, variant=null) {
+    for (const v of variant ? [variant] : tflite.wasmVariants()) {
+      try {
+        return await loadWasmVariant(Object.assign({}, module), v);
+      } catch (error) {
+        console.warn(error);
+      }
     }
-    return rgbArray;
+    throw new Error('Cannot load interpreter');
+  }
+
+  // Firmware flashed by the interpreter when the accelerator is found in DFU
+  // mode (1a6e:089a) while creating an Edge TPU interpreter. Only needed to
+  // override Module.firmwareUrl, which is fetched when flashing otherwise.
+  tflite.setFirmware = function(buffer) {
+    const firmware = new Uint8Array(buffer);
+    const firmwarePtr = Module._malloc(firmware.length);
+    Module.HEAPU8.set(firmware, firmwarePtr);
+    Module.cwrap('set_dfu_firmware', null, ['number', 'number'])(firmwarePtr, firmware.length);
+    Module._free(firmwarePtr);
+  }
+
+  // Must match DfuResult in tflite/libusb.cc.
+  const DFU_RESULTS = ['none', 'flashed', 'needs-permission', 'failed'];
+
+  // Outcome of the last firmware flash. 'needs-permission' means the device
+  // was flashed but has to be selected again from a user gesture.
+  tflite.firmwareStatus = function() {
+    const report = Module.cwrap('get_dfu_report', 'number', [])() /
+                   Module.HEAP32.BYTES_PER_ELEMENT;
+    return {
+      'result': DFU_RESULTS[Module.HEAP32[report]],
+      'bytes': Module.HEAP32[report + 1],
+      'timeMs': Module.HEAP32[report + 2],
+    };
   }
 
-  function callbackKey(id) {
-    return 'interpreter_' + id;
+  // Finds the accelerator, flashing it when in DFU mode, without creating an
+  // interpreter. Resolves with whether a flashed device is available.
+  tflite.findDevice = async function() {
+    return await Module.cwrap('find_device', 'number', [], { async: true })() != 0;
   }
 
   tflite.setRgbInput = function(interpreter, rgbArray, index=0) {
-    const shape = interpreter.inputShape(index);
-    if (rgbArray.length != shape.reduce((a, b) => a * b))
+    const tensor = interpreter.inputTensor(index);
+    const flip = pixelSignFlip(tensor);
+    if (rgbArray.length != tensor.bytes)
       throw new Error('Invalid input array size');
 
-    writeArrayToMemory(rgbArray,  interpreter.inputBuffer(index));
+    if (!flip) {
+      writeArrayToMemory(rgbArray, tensor.buffer);
+      return;
+    }
+
+    const input = Module.HEAPU8;
+    for (let i = 0, j = tensor.buffer; i < rgbArray.length; ++i, ++j)
+      input[j] = rgbArray[i] ^ flip;
   }
 
-  tflite.setRgbaInput = function(interpreter, rgbaArray) {
-    tflite.setRgbInput(interpreter, rgbaArrayToRgbArray(rgbaArray));
+  tflite.setRgbaInput = function(interpreter, rgbaArray, index=0) {
+    const tensor = interpreter.inputTensor(index);
+    const flip = pixelSignFlip(tensor);
+    if (3 * rgbaArray.length / 4 != tensor.bytes)
+      throw new Error('Invalid input array size');
+
+    const input = Module.HEAPU8;
+    for (let i = 0, j = tensor.buffer; i < rgbaArray.length; i += 4, j += 3) {
+      input[j + 0] = rgbaArray[i + 0] ^ flip;
+      input[j + 1] = rgbaArray[i + 1] ^ flip;
+      input[j + 2] = rgbaArray[i + 2] ^ flip;
+    }
   }
 
   tflite.getClassificationOutput = function(interpreter, index=0) {
-    const count = interpreter.outputShape(index).reduce((a, b) => a * b);
-    const scoresPtr = interpreter.outputBuffer(index) / Module.HEAPU8.BYTES_PER_ELEMENT;
-    const scores = Module.HEAPU8.slice(scoresPtr, scoresPtr + count);
-    return scores.indexOf(Math.max(...scores));
+    const scores = tensorArray(interpreter.outputTensor(index));
+    let maxIndex = 0;
+    for (let i = 1; i < scores.length; ++i)
+      if (scores[i] > scores[maxIndex]) maxIndex = i;
+    return maxIndex;
+  }
+
+  tflite.numPrimitives = function(primitives) {
+    return primitives.length / PRIMITIVE_WORDS;
+  }
+
+  // Primitives are [kind, x, y, width, height, classId, score, trackId] in
+  // canvas coordinates, see interpreter.setPostProcess(). trackId is -1 unless
+  // tracking is enabled.
+  tflite.drawPrimitives = function(ctx, primitives, labels) {
+    for (let i = 0; i < primitives.length; i += PRIMITIVE_WORDS) {
+      if (primitives[i] != PRIMITIVE_BOX) continue;
+      const [x, y, w, h, id, _, trackId] = primitives.subarray(i + 1, i + 8);
+      ctx.strokeRect(x, y, w, h);
+      ctx.fillText(trackId < 0 ? labels[id] : `${labels[id]} #${trackId}`, x + 5, y + 5);
+    }
   }
 
   tflite.getDetectionOutput = function(interpreter, threshold=0.0) {
@@ -87,27 +337,28 @@ const tflite = {};
   tflite.Interpreter = function() {
     this.interpreter_create       = Module.cwrap('interpreter_create',  'number', ['number'], { async: true });
     this.interpreter_destroy      = Module.cwrap('interpreter_destroy', null,     ['number']);
-
-    this.interpreter_num_inputs     = Module.cwrap('interpreter_num_inputs',     'number',   ['number']);
-    this.interpreter_input_buffer   = Module.cwrap('interpreter_input_buffer',   'number',   ['number', 'number']);
-    this.interpreter_num_input_dims = Module.cwrap('interpreter_num_input_dims', 'number',   ['number', 'number']);
-    this.interpreter_input_dim      = Module.cwrap('interpreter_input_dim',      'number',   ['number', 'number', 'number']);
-
-    this.interpreter_num_outputs     = Module.cwrap('interpreter_num_outputs',     'number',   ['number']);
-    this.interpreter_output_buffer   = Module.cwrap('interpreter_output_buffer',   'number',   ['number', 'number']);
-    this.interpreter_num_output_dims = Module.cwrap('interpreter_num_output_dims', 'number',   ['number', 'number']);
-    this.interpreter_output_dim      = Module.cwrap('interpreter_output_dim',      'number',   ['number', 'number', 'number']);
-
+    this.interpreter_cancel       = Module.cwrap('interpreter_cancel',  null,     ['number']);
+    this.interpreter_describe     = Module.cwrap('interpreter_describe', 'number', ['number']);
+
+    this.interpreter_set_postprocess = Module.cwrap('interpreter_set_postprocess', null,
+        ['number', 'number', 'number', 'number', 'number', 'number']);
+    this.interpreter_set_tracking = Module.cwrap('interpreter_set_tracking', null,
+        ['number', 'number', 'number', 'number']);
+    this.interpreter_num_invokes = Module.cwrap('interpreter_num_invokes', 'number', ['number']);
+    this.interpreter_primitives = Module.cwrap('interpreter_primitives', 'number', ['number', 'number']);
+    this.interpreter_decode_time = Module.cwrap('interpreter_decode_time', 'number', ['number', 'number']);
+    this.interpreter_release_primitives = Module.cwrap('interpreter_release_primitives', null, ['number', 'number']);
     this.interpreter_invoke_async = Module.cwrap('interpreter_invoke_async', null, ['number', 'number']);
 
     this.id = nextId++;
+    this.nextFrame = 0;
+    this.frames = new Map();
+    pendingInvokes.set(this.id, []);
 
-    Module['invokeDone'] = function(id, result) {
-      const key = callbackKey(id);
-      const callback = Module[key];
-      if (callback) callback(result);
-      delete Module[key];
-    };
+    if (!completionRing) {
+      completionRing = Module.cwrap('interpreter_completion_ring', 'number', [])();
+      watchCompletions();
+    }
   }
 
   tflite.Interpreter.prototype.createFromBuffer = async function(buffer) {
@@ -120,72 +371,153 @@ const tflite = {};
     if (this.interpreter == null)
       return false;
 
-    this.input_shapes = [];
-    this.input_buffers = [];
-    const num_inputs = this.interpreter_num_inputs(this.interpreter);
-    for (let ti = 0; ti < num_inputs; ++ti) {
-      const shape = [];
-      const dims = this.interpreter_num_input_dims(this.interpreter, ti);
-      for (let i = 0; i < dims; ++i)
-        shape.push(this.interpreter_input_dim(this.interpreter, ti, i));
-      this.input_shapes.push(shape);
-
-      const buffer = this.interpreter_input_buffer(this.interpreter, ti);
-      this.input_buffers.push(buffer);
-    }
-
-    this.output_shapes = [];
-    this.output_buffers = [];
-    const num_outputs = this.interpreter_num_outputs(this.interpreter);
-    for (let ti = 0; ti < num_outputs; ++ti) {
-      const shape = [];
-      const dims = this.interpreter_num_output_dims(this.interpreter, ti);
-      for (let i = 0; i < dims; ++i)
-        shape.push(this.interpreter_output_dim(this.interpreter, ti, i));
-      this.output_shapes.push(shape);
-
-      const buffer = this.interpreter_output_buffer(this.interpreter, ti);
-      this.output_buffers.push(buffer);
-    }
-
+    [this.inputs, this.outputs] =
+        readTensorDescriptors(this.interpreter_describe(this.interpreter));
     return true;
   }
 
+  // Rejects pending invokes and resolves once the interpreter is gone. Queued
+  // invokes are failed without running; the one in progress has to finish
+  // first because interpreter_destroy() blocks the main thread, which an Edge
+  // TPU invoke needs for its WebUSB transfers.
   tflite.Interpreter.prototype.destroy = function() {
-    this.interpreter_destroy(this.interpreter);
+    for (let i = waitingInvokes.length - 1; i >= 0; --i) {
+      if (waitingInvokes[i][0] !== this) continue;
+      waitingInvokes[i][1].cancel();
+      waitingInvokes.splice(i, 1);
+    }
+
+    const self = this;
+    const callbacks = pendingInvokes.get(this.id);
+    return new Promise(resolve => {
+      const finish = () => {
+        pendingInvokes.delete(self.id);
+        self.interpreter_destroy(self.interpreter);
+        resolve();
+      };
+      if (!callbacks.length) {
+        finish();
+        return;
+      }
+
+      // Completions still arrive in order; the last one finishes the destroy.
+      self.interpreter_cancel(self.interpreter);
+      const last = callbacks.length - 1;
+      callbacks.forEach((callback, i) => {
+        callback.cancel();
+        callbacks[i] = {'done': i == last ? finish : () => {}, 'cancel': () => {}};
+      });
+    });
   }
 
   tflite.Interpreter.prototype.numInputs = function() {
-    return this.input_shapes.length;
+    return this.inputs.length;
+  }
+
+  tflite.Interpreter.prototype.inputTensor = function(index) {
+    return this.inputs[index];
   }
 
   tflite.Interpreter.prototype.inputBuffer = function(index) {
-    return this.input_buffers[index];
+    return this.inputs[index].buffer;
   }
 
   tflite.Interpreter.prototype.inputShape = function(index) {
-    return this.input_shapes[index];
+    return this.inputs[index].shape;
   }
 
   tflite.Interpreter.prototype.numOutputs = function() {
-    return this.output_shapes.length;
+    return this.outputs.length;
+  }
+
+  tflite.Interpreter.prototype.outputTensor = function(index) {
+    return this.outputs[index];
   }
 
   tflite.Interpreter.prototype.outputBuffer = function(index) {
-    return this.output_buffers[index];
+    return this.outputs[index].buffer;
   }
 
   tflite.Interpreter.prototype.outputShape = function(index) {
-    return this.output_shapes[index];
+    return this.outputs[index].shape;
+  }
+
+  // Decodes outputs of each following invoke on the interpreter's worker pool.
+  // `type` is 'classification' (top-K scores above threshold) or 'detection'
+  // (boxes above threshold scaled to width x height), or 'none'.
+  tflite.Interpreter.prototype.setPostProcess = function(type, options={}) {
+    if (!(type in POSTPROCESS_TYPES))
+      throw new Error(`Unknown post-processing type: ${type}`);
+    this.interpreter_set_postprocess(this.interpreter, POSTPROCESS_TYPES[type],
+                                     options.threshold || 0.0,
+                                     options.topK || 1,
+                                     options.width || 1.0,
+                                     options.height || 1.0);
+  }
+
+  // Tracks 'detection' results across invokes with stable track ids. The
+  // detector only runs every `detectInterval` frames, or earlier when more
+  // than `motionThreshold` (mean absolute input change in [0, 1]) of the input
+  // changed since the last detection; tracks are propagated in between.
+  // `detectInterval` of 0 disables tracking.
+  tflite.Interpreter.prototype.setTracking = function(options={}) {
+    this.interpreter_set_tracking(this.interpreter,
+                                  options.detectInterval || 0,
+                                  options.motionThreshold || 0.0,
+                                  options.iouThreshold || 0.3);
+  }
+
+  // Number of times the model actually ran, to measure skipped detections.
+  tflite.Interpreter.prototype.numInvokes = function() {
+    return this.interpreter_num_invokes(this.interpreter);
   }
 
+  // Results of a post-processed invoke, kept until four more invokes of this
+  // interpreter complete. Empty when post-processing is 'none'.
+  tflite.Interpreter.prototype.primitives = function(frame) {
+    const result = this.frames.get(frame);
+    return result ? result.primitives : new Float32Array(0);
+  }
+
+  // Milliseconds the worker pool spent decoding (and tracking) the frame. This
+  // happens before invoke() resolves, so it is part of the time it took.
+  tflite.Interpreter.prototype.decodeTime = function(frame) {
+    const result = this.frames.get(frame);
+    return result ? result.decodeMs : 0.0;
+  }
+
+  // Copies the results out of a result slot as soon as the invoke completes
+  // and hands the slot back for reuse.
+  function takeResult(interpreter, slot) {
+    const ptr = interpreter.interpreter_primitives(interpreter.interpreter, slot) /
+                Module.HEAPF32.BYTES_PER_ELEMENT;
+    const count = Module.HEAPF32[ptr];
+    const result = {
+      'primitives': Module.HEAPF32.slice(ptr + 1, ptr + 1 + count * PRIMITIVE_WORDS),
+      'decodeMs': interpreter.interpreter_decode_time(interpreter.interpreter, slot),
+    };
+    interpreter.interpreter_release_primitives(interpreter.interpreter, slot);
+    return result;
+  }
+
+  // Resolves with the frame to pass to primitives().
   tflite.Interpreter.prototype.invoke = function() {
     const self = this;
     return new Promise((resolve, reject) => {
-      Module[callbackKey(self.id)] = result => {
-        (result ? resolve : reject)();
-      };
-      self.interpreter_invoke_async(self.interpreter, self.id);
+      submitInvoke(self, {
+        'done': result => {
+          if (!result) {
+            reject();
+            return;
+          }
+          const frame = self.nextFrame++;
+          if (result >= INVOKE_SLOT)
+            self.frames.set(frame, takeResult(self, result - INVOKE_SLOT));
+          self.frames.delete(frame - RESULT_FRAMES);
+          resolve(frame);
+        },
+        'cancel': () => reject(new Error('Interpreter destroyed')),
+      });
     });
   }
 })();
@@ -0,0 +1,69 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef TFLITE_COMPLETION_RING_H_
+#define TFLITE_COMPLETION_RING_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#include <emscripten/threading.h>
+
+// Ring of (id, result) pairs living in the shared wasm heap. Interpreter
+// threads push completions and notify on `head`; JS drains them from the main
+// thread with Atomics.waitAsync, advances `tail` and notifies it back.
+//
+// Only the consumer side is lock-free: the main thread never takes a lock or
+// blocks. Producers serialize on a mutex, which is only contended between
+// interpreter and post-processing threads, never with the main thread.
+// tflite.js keeps at most kCapacity invokes in flight, so Push() never has to
+// wait for space while the main thread is blocked joining an interpreter.
+//
+// Memory layout (int32 words) read directly by tflite.js:
+//   [0] head, [1] tail, [2] capacity, [3 + 2 * i] id, [4 + 2 * i] result
+class CompletionRing {
+ public:
+  static constexpr uint32_t kCapacity = 64;
+  static_assert((kCapacity & (kCapacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+  CompletionRing() : head_(0), tail_(0), capacity_(kCapacity) {}
+
+  void Push(int32_t id, int32_t result) {
+    std::lock_guard<std::mutex> lock(m_);  // Producers only.
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    // Unreachable through tflite.js, kept so that other callers cannot
+    // overwrite entries JS has not read yet.
+    while (true) {
+      uint32_t tail = tail_.load(std::memory_order_acquire);
+      if (head - tail < capacity_) break;
+      emscripten_futex_wait(&tail_, tail, /*max_wait_ms=*/10);
+    }
+
+    auto* entry = entries_[head & (capacity_ - 1)];
+    entry[0] = id;
+    entry[1] = result;
+    head_.store(head + 1, std::memory_order_release);
+    emscripten_futex_wake(&head_, INT32_MAX);
+  }
+
+ private:
+  std::atomic<uint32_t> head_;
+  std::atomic<uint32_t> tail_;
+  const uint32_t capacity_;
+  int32_t entries_[kCapacity][2];
+  std::mutex m_;
+};
+
+#endif  // TFLITE_COMPLETION_RING_H_
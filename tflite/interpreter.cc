@@ -11,12 +11,21 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include <emscripten.h>
 
@@ -27,13 +36,255 @@
 #include "tensorflow/lite/interpreter_builder.h"
 #include "tensorflow/lite/kernels/register.h"  // BuiltinOpResolver
 
+#include "tflite/completion_ring.h"
 #include "tflite/queue.h"
+#include "tflite/task_pool.h"
+#include "tflite/tracker.h"
 
 namespace {
 
 constexpr char kEdgeTpuCustomOp[] = "edgetpu-custom-op";
 constexpr int kExit = -1;
 
+// Table returned by interpreter_describe(), as 32-bit words:
+//   [0] num_inputs, [1] num_outputs,
+//   then kDescriptorWords per input and output tensor (see TensorField),
+//   then the dims of all tensors, then NUL-terminated tensor names.
+enum TensorField {
+  kType = 0,        // TfLiteType
+  kBytes,           // Tensor size in bytes
+  kBuffer,          // Pointer to tensor data
+  kScale,           // float
+  kZeroPoint,
+  kNumDims,
+  kDimsOffset,      // Word offset of the dims in the table
+  kNameOffset,      // Byte offset of the name in the table
+  kDescriptorWords,
+};
+
+// Post-processing runs on a shared pool so that it overlaps with the next
+// invoke. Each interpreter keeps kResultSlots frames of results in flight; a
+// slot is reused only after JS copied its primitives and released it.
+constexpr size_t kPostProcessThreads = 2;
+constexpr uint32_t kResultSlots = 4;
+
+enum PostProcessType {
+  kPostProcessNone = 0,
+  kPostProcessClassification,
+  kPostProcessDetection,
+};
+
+// Draw-ready primitives returned by interpreter_primitives(), as floats:
+//   [0] count, then kPrimitiveWords per primitive (see PrimitiveField).
+enum PrimitiveField {
+  kKind = 0,        // PrimitiveKind
+  kX,               // Canvas coordinates
+  kY,
+  kWidth,
+  kHeight,
+  kClassId,
+  kScore,
+  kTrackId,         // -1 when tracking is disabled
+  kPrimitiveWords,
+};
+
+enum PrimitiveKind {
+  kLabel = 0,       // Classification result, no geometry
+  kBox,
+};
+
+struct PostProcessConfig {
+  int type = kPostProcessNone;
+  float threshold = 0.0f;
+  int top_k = 1;
+  float width = 1.0f;
+  float height = 1.0f;
+};
+
+// Detection-only: run the detector every `detect_interval` frames, or sooner
+// when the input changed by more than `motion_threshold` (mean absolute
+// difference in [0, 1]) since the last detection; propagate tracks otherwise.
+// `detect_interval` == 0 disables tracking.
+struct TrackingConfig {
+  int detect_interval = 0;
+  float motion_threshold = 0.0f;
+  float iou_threshold = 0.3f;
+};
+
+// Every kMotionStride-th input byte is compared for motion detection.
+constexpr size_t kMotionStride = 61;
+
+// Copy of an output tensor taken right after invoke.
+struct OutputSnapshot {
+  TfLiteType type;
+  float scale;
+  int32_t zero_point;
+  std::vector<uint8_t> data;
+
+  size_t size() const {
+    return type == kTfLiteFloat32 ? data.size() / sizeof(float) : data.size();
+  }
+
+  float operator[](size_t i) const {
+    switch (type) {
+      case kTfLiteUInt8:
+        return (data[i] - zero_point) * scale;
+      case kTfLiteInt8:
+        return (static_cast<int8_t>(data[i]) - zero_point) * scale;
+      case kTfLiteFloat32:
+        return reinterpret_cast<const float*>(data.data())[i];
+      default:
+        return 0.0f;
+    }
+  }
+};
+
+struct ResultSlot {
+  std::vector<OutputSnapshot> outputs;
+  std::vector<float> primitives;
+  float decode_ms = 0.0f;  // Decoding (and tracking), excluding invoke.
+  bool in_use = false;     // Guarded by Interpreter::commit_mutex_.
+};
+
+// Invoke results passed to JS through the completion ring.
+enum InvokeResult {
+  kInvokeFailed = 0,
+  kInvokeOk,          // No post-processing
+  kInvokeSlot,        // kInvokeSlot + i: primitives are in result slot i
+};
+
+CompletionRing completions;
+
+float ElapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<float, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+TaskPool& PostProcessPool() {
+  static TaskPool pool(kPostProcessThreads);
+  return pool;
+}
+
+void AddPrimitive(std::vector<float>* primitives, PrimitiveKind kind,
+                  float x, float y, float width, float height,
+                  int class_id, float score, int track_id = -1) {
+  primitives->insert(primitives->end(),
+                     {static_cast<float>(kind), x, y, width, height,
+                      static_cast<float>(class_id), score,
+                      static_cast<float>(track_id)});
+  (*primitives)[0] += 1;
+}
+
+bool DecodeClassification(const PostProcessConfig& config, ResultSlot* slot) {
+  if (slot->outputs.empty()) return false;
+  const auto& scores = slot->outputs[0];
+
+  std::vector<std::pair<float, int>> top;
+  for (size_t i = 0; i < scores.size(); ++i) {
+    const float score = scores[i];
+    if (score >= config.threshold) top.emplace_back(score, i);
+  }
+
+  const size_t k = std::min<size_t>(std::max(config.top_k, 0), top.size());
+  std::partial_sort(top.begin(), top.begin() + k, top.end(),
+                    [](const auto& a, const auto& b) { return a > b; });
+  for (size_t i = 0; i < k; ++i)
+    AddPrimitive(&slot->primitives, kLabel, 0, 0, 0, 0, top[i].second,
+                 top[i].first);
+  return true;
+}
+
+bool DecodeDetection(const PostProcessConfig& config, ResultSlot* slot) {
+  // SSD postprocess outputs: boxes, class ids, scores, count.
+  const auto& outputs = slot->outputs;
+  if (outputs.size() < 4) return false;
+  for (size_t i = 0; i < 4; ++i)
+    if (outputs[i].type != kTfLiteFloat32) return false;
+
+  const auto& bboxes = outputs[0];
+  const auto& ids = outputs[1];
+  const auto& scores = outputs[2];
+  const size_t count = std::min<size_t>(std::max(outputs[3][0], 0.0f),
+                                        scores.size());
+  for (size_t i = 0; i < count; ++i) {
+    if (scores[i] < config.threshold) break;
+
+    const float ymin = std::max(0.0f, bboxes[4 * i]);
+    const float xmin = std::max(0.0f, bboxes[4 * i + 1]);
+    const float ymax = std::min(1.0f, bboxes[4 * i + 2]);
+    const float xmax = std::min(1.0f, bboxes[4 * i + 3]);
+    AddPrimitive(&slot->primitives, kBox,
+                 xmin * config.width, ymin * config.height,
+                 (xmax - xmin) * config.width, (ymax - ymin) * config.height,
+                 static_cast<int>(ids[i]), scores[i]);
+  }
+  return true;
+}
+
+std::vector<Detection> ToDetections(const std::vector<float>& primitives) {
+  std::vector<Detection> detections;
+  for (size_t i = 1; i + kPrimitiveWords <= primitives.size();
+       i += kPrimitiveWords) {
+    const float* p = &primitives[i];
+    detections.push_back({{p[kX], p[kY], p[kWidth], p[kHeight]},
+                          static_cast<int>(p[kClassId]), p[kScore]});
+  }
+  return detections;
+}
+
+void AddTracks(const PostProcessConfig& config, const Tracker& tracker,
+               std::vector<float>* primitives) {
+  primitives->assign(1, 0.0f);
+  for (const auto& track : tracker.tracks()) {
+    if (track.misses > 0) continue;
+    const Box& b = track.box;
+    const float x = std::clamp(b.x, 0.0f, config.width);
+    const float y = std::clamp(b.y, 0.0f, config.height);
+    const float width = std::clamp(b.x + b.width, 0.0f, config.width) - x;
+    const float height = std::clamp(b.y + b.height, 0.0f, config.height) - y;
+    if (width <= 0 || height <= 0) continue;
+    AddPrimitive(primitives, kBox, x, y, width, height, track.class_id,
+                 track.score, track.id);
+  }
+}
+
+// Samples the input tensor as values in [0, 1].
+std::vector<float> SampleInput(const TfLiteTensor* tensor) {
+  std::vector<float> samples;
+  for (size_t i = 0; i < tensor->bytes; i += kMotionStride) {
+    switch (tensor->type) {
+      case kTfLiteUInt8:
+        samples.push_back(tensor->data.uint8[i] / 255.0f);
+        break;
+      case kTfLiteInt8:
+        samples.push_back((tensor->data.int8[i] + 128) / 255.0f);
+        break;
+      default:
+        return samples;  // Motion detection unsupported, rely on interval.
+    }
+  }
+  return samples;
+}
+
+float Motion(const std::vector<float>& a, const std::vector<float>& b) {
+  if (a.empty() || a.size() != b.size()) return 0.0f;
+  float sum = 0.0f;
+  for (size_t i = 0; i < a.size(); ++i) sum += std::abs(a[i] - b[i]);
+  return sum / a.size();
+}
+
+bool Decode(const PostProcessConfig& config, ResultSlot* slot) {
+  slot->primitives.assign(1, 0.0f);
+  switch (config.type) {
+    case kPostProcessClassification:
+      return DecodeClassification(config, slot);
+    case kPostProcessDetection:
+      return DecodeDetection(config, slot);
+    default:
+      return false;
+  }
+}
+
 using DelegatePtr = std::unique_ptr<TfLiteDelegate,
                                     decltype(&edgetpu_free_delegate)>;
 
@@ -55,16 +306,20 @@ class Interpreter {
     while (true) {
       if (auto cmd = queue_.Pop(250/*ms*/)) {
         if (cmd.value() == kExit) break;
-        auto result = Invoke();
-        MAIN_THREAD_ASYNC_EM_ASM({Module['invokeDone']($0, $1);},
-                                 cmd.value(), result);
+        Run(cmd.value());
       }
     }
-  }) {}
+  }) {
+    PostProcessPool();  // Start pool threads from the main thread.
+  }
 
   ~Interpreter() {
+    Cancel();
     queue_.Push(kExit);
     thread_.join();
+
+    std::unique_lock<std::mutex> lock(commit_mutex_);
+    commit_cv_.wait(lock, [this] { return next_commit_ == next_seq_; });
   }
 
  public:
@@ -124,59 +379,294 @@ class Interpreter {
       return false;
     }
 
+    BuildDescription();
     return true;
   }
 
- public:
-  size_t NumInputs() const {
-    return interpreter_->inputs().size();
+  const int32_t* Describe() const {
+    return description_.data();
   }
 
-  void* InputBuffer(size_t tensor_index) const {
-    return interpreter_->input_tensor(tensor_index)->data.data;
+ public:
+  bool Invoke() {
+    ++num_invokes_;
+    if (interpreter_->Invoke() != kTfLiteOk) {
+      std::cerr << "[ERROR] Cannot invoke interpreter" << std::endl;
+      return false;
+    }
+    return true;
   }
 
-  const size_t NumInputDims(size_t tensor_index) const {
-    return interpreter_->input_tensor(tensor_index)->dims->size;
+  void InvokeAsync(size_t id) {
+    queue_.Push(id);
   }
 
-  const size_t InputDim(size_t tensor_index, size_t dim) const {
-    return interpreter_->input_tensor(tensor_index)->dims->data[dim];
+  // Fails queued invokes without running them. JS no longer releases slots at
+  // this point, so the thread must not wait for them either.
+  void Cancel() {
+    {
+      std::lock_guard<std::mutex> lock(commit_mutex_);
+      exiting_ = true;
+    }
+    commit_cv_.notify_all();
   }
 
  public:
-  size_t NumOutputs() const {
-    return interpreter_->outputs().size();
+  void SetPostProcess(const PostProcessConfig& config) {
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    // Tracks in old canvas coordinates or from other detections are stale.
+    if (config.type != config_.type || config.width != config_.width ||
+        config.height != config_.height || config.threshold != config_.threshold)
+      ++tracking_generation_;
+    config_ = config;
   }
 
-  const void* OutputBuffer(size_t tensor_index) const {
-    return interpreter_->output_tensor(tensor_index)->data.data;
+  void SetTracking(const TrackingConfig& tracking) {
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    if (tracking.detect_interval != tracking_.detect_interval ||
+        tracking.motion_threshold != tracking_.motion_threshold ||
+        tracking.iou_threshold != tracking_.iou_threshold)
+      ++tracking_generation_;
+    tracking_ = tracking;
   }
 
-  const size_t NumOutputDims(size_t tensor_index) const {
-    return interpreter_->output_tensor(tensor_index)->dims->size;
+  size_t NumInvokes() const {
+    return num_invokes_;
   }
 
-  const int OutputDim(size_t tensor_index, size_t dim) const {
-    return interpreter_->output_tensor(tensor_index)->dims->data[dim];
+  const float* Primitives(size_t slot) const {
+    return slots_[slot % kResultSlots].primitives.data();
   }
 
- public:
-  bool Invoke() {
-    if (interpreter_->Invoke() != kTfLiteOk) {
-      std::cerr << "[ERROR] Cannot invoke interpreter" << std::endl;
-      return false;
+  float DecodeTime(size_t slot) const {
+    return slots_[slot % kResultSlots].decode_ms;
+  }
+
+  void ReleasePrimitives(size_t slot) {
+    {
+      std::lock_guard<std::mutex> lock(commit_mutex_);
+      slots_[slot % kResultSlots].in_use = false;
     }
+    commit_cv_.notify_all();
+  }
+
+ private:
+  // Runs on the interpreter thread for each invoke request, see InvokeResult.
+  void Run(int id) {
+    bool exiting;
+    {
+      std::lock_guard<std::mutex> lock(commit_mutex_);
+      exiting = exiting_;
+    }
+    if (exiting) {
+      Commit(next_seq_++, id, kInvokeFailed);
+      return;
+    }
+
+    PostProcessConfig config;
+    TrackingConfig tracking;
+    int generation;
+    {
+      std::lock_guard<std::mutex> lock(config_mutex_);
+      config = config_;
+      tracking = tracking_;
+      generation = tracking_generation_;
+    }
+
+    if (generation != active_tracking_generation_) {
+      active_tracking_generation_ = generation;
+      tracker_.Reset();
+      has_keyframe_ = false;
+    }
+
+    if (config.type == kPostProcessDetection && tracking.detect_interval > 0)
+      Track(id, config, tracking);
+    else
+      PostProcess(id, config, Invoke());
+  }
+
+  void PostProcess(int id, const PostProcessConfig& config, bool ok) {
+    const uint32_t seq = next_seq_++;
+    if (!ok || config.type == kPostProcessNone) {
+      Commit(seq, id, ok ? kInvokeOk : kInvokeFailed);
+      return;
+    }
+
+    const uint32_t index = seq % kResultSlots;
+    if (!AcquireSlot(index)) {
+      Commit(seq, id, kInvokeFailed);
+      return;
+    }
+    SnapshotOutputs(&slots_[index]);
+    PostProcessPool().Submit([this, config, seq, index, id]() {
+      auto& slot = slots_[index];
+      const auto start = std::chrono::steady_clock::now();
+      const bool decoded = Decode(config, &slot);
+      slot.decode_ms = ElapsedMs(start);
+      CommitSlot(seq, id, index, decoded);
+    });
+  }
+
+  // Tracking is sequential, so it runs here rather than on the pool.
+  void Track(int id, const PostProcessConfig& config,
+             const TrackingConfig& tracking) {
+    const uint32_t seq = next_seq_++;
+    const uint32_t index = seq % kResultSlots;
+    if (!AcquireSlot(index)) {
+      Commit(seq, id, kInvokeFailed);
+      return;
+    }
+    auto& slot = slots_[index];
+
+    bool ok = true;
+    float decode_ms = 0.0f;
+    tracker_.Predict();
+    if (ShouldDetect(tracking)) {
+      ok = Invoke();
+      if (ok) {
+        SnapshotOutputs(&slot);
+        const auto start = std::chrono::steady_clock::now();
+        ok = Decode(config, &slot);
+        if (ok) tracker_.Update(ToDetections(slot.primitives),
+                                tracking.iou_threshold);
+        decode_ms = ElapsedMs(start);
+      }
+    }
+    const auto start = std::chrono::steady_clock::now();
+    if (ok) AddTracks(config, tracker_, &slot.primitives);
+    slot.decode_ms = decode_ms + ElapsedMs(start);
+
+    CommitSlot(seq, id, index, ok);
+  }
+
+  bool ShouldDetect(const TrackingConfig& tracking) {
+    auto samples = SampleInput(interpreter_->input_tensor(0));
+    bool detect = !has_keyframe_ ||
+                  ++frames_since_detect_ >= tracking.detect_interval;
+    if (!detect && tracking.motion_threshold > 0.0f)
+      detect = Motion(keyframe_, samples) > tracking.motion_threshold;
+
+    if (detect) {
+      keyframe_ = std::move(samples);
+      has_keyframe_ = true;
+      frames_since_detect_ = 0;
+    }
+    return detect;
+  }
+
+  // Waits until JS released the slot of the frame kResultSlots ago. Slots are
+  // released in commit order, so this also bounds frames in flight.
+  bool AcquireSlot(uint32_t index) {
+    std::unique_lock<std::mutex> lock(commit_mutex_);
+    auto& slot = slots_[index];
+    commit_cv_.wait(lock, [&] { return !slot.in_use || exiting_; });
+    if (exiting_) return false;
+    slot.in_use = true;
     return true;
   }
 
-  void InvokeAsync(size_t id) {
-    queue_.Push(id);
+  void SnapshotOutputs(ResultSlot* slot) const {
+    auto& outputs = slot->outputs;
+    outputs.resize(interpreter_->outputs().size());
+    for (size_t i = 0; i < outputs.size(); ++i) {
+      const auto* tensor = interpreter_->output_tensor(i);
+      outputs[i].type = tensor->type;
+      outputs[i].scale = tensor->params.scale;
+      outputs[i].zero_point = tensor->params.zero_point;
+      outputs[i].data.assign(tensor->data.uint8,
+                             tensor->data.uint8 + tensor->bytes);
+    }
+  }
+
+  // Hands the slot to JS, or frees it right away when decoding failed.
+  void CommitSlot(uint32_t seq, int id, uint32_t index, bool ok) {
+    if (!ok) ReleasePrimitives(index);
+    Commit(seq, id, ok ? kInvokeSlot + index : kInvokeFailed);
+  }
+
+  // Completions are delivered to JS in invoke order.
+  void Commit(uint32_t seq, int id, int result) {
+    std::lock_guard<std::mutex> lock(commit_mutex_);
+    ready_[seq] = {id, result};
+    for (auto it = ready_.find(next_commit_); it != ready_.end();
+         it = ready_.find(next_commit_)) {
+      completions.Push(it->second.first, it->second.second);
+      ready_.erase(it);
+      ++next_commit_;
+    }
+    commit_cv_.notify_all();
+  }
+
+ private:
+  void BuildDescription() {
+    std::vector<const TfLiteTensor*> tensors;
+    for (int index : interpreter_->inputs())
+      tensors.push_back(interpreter_->tensor(index));
+    for (int index : interpreter_->outputs())
+      tensors.push_back(interpreter_->tensor(index));
+
+    auto& table = description_;
+    table.assign(2 + kDescriptorWords * tensors.size(), 0);
+    table[0] = interpreter_->inputs().size();
+    table[1] = interpreter_->outputs().size();
+
+    std::vector<char> names;
+    for (size_t i = 0; i < tensors.size(); ++i) {
+      const auto* tensor = tensors[i];
+      int32_t* d = &table[2 + kDescriptorWords * i];
+      d[kType] = tensor->type;
+      d[kBytes] = tensor->bytes;
+      d[kBuffer] = reinterpret_cast<intptr_t>(tensor->data.raw);
+      std::memcpy(&d[kScale], &tensor->params.scale, sizeof(float));
+      d[kZeroPoint] = tensor->params.zero_point;
+      d[kNumDims] = tensor->dims->size;
+      d[kNameOffset] = names.size();
+
+      const char* name = tensor->name ? tensor->name : "";
+      names.insert(names.end(), name, name + std::strlen(name) + 1);
+    }
+
+    for (size_t i = 0; i < tensors.size(); ++i) {
+      const auto* dims = tensors[i]->dims;
+      table[2 + kDescriptorWords * i + kDimsOffset] = table.size();
+      table.insert(table.end(), dims->data, dims->data + dims->size);
+    }
+
+    const size_t names_offset = table.size() * sizeof(int32_t);
+    for (size_t i = 0; i < tensors.size(); ++i)
+      table[2 + kDescriptorWords * i + kNameOffset] += names_offset;
+
+    table.resize(table.size() + (names.size() + 3) / sizeof(int32_t));
+    std::memcpy(reinterpret_cast<char*>(table.data()) + names_offset,
+                names.data(), names.size());
   }
 
  private:
   std::unique_ptr<tflite::FlatBufferModel> model_;
   std::unique_ptr<tflite::Interpreter> interpreter_;
+  std::vector<int32_t> description_;
+
+  std::mutex config_mutex_;
+  PostProcessConfig config_;
+  ResultSlot slots_[kResultSlots];
+  TrackingConfig tracking_;
+  int tracking_generation_ = 0;
+  std::atomic<size_t> num_invokes_{0};
+
+  // Interpreter thread only.
+  uint32_t next_seq_ = 0;
+  int active_tracking_generation_ = 0;
+  Tracker tracker_;
+  std::vector<float> keyframe_;
+  bool has_keyframe_ = false;
+  int frames_since_detect_ = 0;
+
+  std::mutex commit_mutex_;
+  std::condition_variable commit_cv_;
+  uint32_t next_commit_ = 0;
+  bool exiting_ = false;
+  std::unordered_map<uint32_t, std::pair<int, int>> ready_;
+
   Queue<int> queue_;
   std::thread thread_;
 };
@@ -201,46 +691,61 @@ void interpreter_destroy(void* p) {
   delete reinterpret_cast<Interpreter*>(p);
 }
 
-// Inputs
 EMSCRIPTEN_KEEPALIVE
-size_t interpreter_num_inputs(void* interpreter) {
-  return reinterpret_cast<Interpreter*>(interpreter)->NumInputs();
+void interpreter_cancel(void* interpreter) {
+  reinterpret_cast<Interpreter*>(interpreter)->Cancel();
+}
+
+EMSCRIPTEN_KEEPALIVE
+const int32_t* interpreter_describe(void* interpreter) {
+  return reinterpret_cast<Interpreter*>(interpreter)->Describe();
 }
 
 EMSCRIPTEN_KEEPALIVE
-void* interpreter_input_buffer(void* interpreter, size_t tensor_index) {
-  return reinterpret_cast<Interpreter*>(interpreter)->InputBuffer(tensor_index);
+void* interpreter_completion_ring() {
+  return &completions;
 }
 
 EMSCRIPTEN_KEEPALIVE
-size_t interpreter_num_input_dims(void *interpreter, size_t tensor_index) {
-  return reinterpret_cast<Interpreter*>(interpreter)->NumInputDims(tensor_index);
+void interpreter_set_postprocess(void* interpreter, int type, float threshold,
+                                 int top_k, float width, float height) {
+  PostProcessConfig config;
+  config.type = type;
+  config.threshold = threshold;
+  config.top_k = top_k;
+  config.width = width;
+  config.height = height;
+  reinterpret_cast<Interpreter*>(interpreter)->SetPostProcess(config);
 }
 
 EMSCRIPTEN_KEEPALIVE
-size_t interpreter_input_dim(void *interpreter, size_t tensor_index, size_t dim) {
-  return reinterpret_cast<Interpreter*>(interpreter)->InputDim(tensor_index, dim);
+void interpreter_set_tracking(void* interpreter, int detect_interval,
+                              float motion_threshold, float iou_threshold) {
+  TrackingConfig tracking;
+  tracking.detect_interval = detect_interval;
+  tracking.motion_threshold = motion_threshold;
+  tracking.iou_threshold = iou_threshold;
+  reinterpret_cast<Interpreter*>(interpreter)->SetTracking(tracking);
 }
 
-// Outputs
 EMSCRIPTEN_KEEPALIVE
-size_t interpreter_num_outputs(void* interpreter) {
-  return reinterpret_cast<Interpreter*>(interpreter)->NumOutputs();
+size_t interpreter_num_invokes(void* interpreter) {
+  return reinterpret_cast<Interpreter*>(interpreter)->NumInvokes();
 }
 
 EMSCRIPTEN_KEEPALIVE
-const void* interpreter_output_buffer(void* interpreter, size_t tensor_index) {
-  return reinterpret_cast<Interpreter*>(interpreter)->OutputBuffer(tensor_index);
+const float* interpreter_primitives(void* interpreter, size_t slot) {
+  return reinterpret_cast<Interpreter*>(interpreter)->Primitives(slot);
 }
 
 EMSCRIPTEN_KEEPALIVE
-size_t interpreter_num_output_dims(void *interpreter, size_t tensor_index) {
-  return reinterpret_cast<Interpreter*>(interpreter)->NumOutputDims(tensor_index);
+float interpreter_decode_time(void* interpreter, size_t slot) {
+  return reinterpret_cast<Interpreter*>(interpreter)->DecodeTime(slot);
 }
 
 EMSCRIPTEN_KEEPALIVE
-size_t interpreter_output_dim(void *interpreter, size_t tensor_index, size_t dim) {
-  return reinterpret_cast<Interpreter*>(interpreter)->OutputDim(tensor_index, dim);
+void interpreter_release_primitives(void* interpreter, size_t slot) {
+  reinterpret_cast<Interpreter*>(interpreter)->ReleasePrimitives(slot);
 }
 
 EMSCRIPTEN_KEEPALIVE
@@ -11,8 +11,11 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <iostream>
+#include <vector>
 
 #include <emscripten.h>
 #include <libusb-1.0/libusb.h>
@@ -53,6 +56,54 @@ struct libusb_device_handle {
   struct libusb_device *dev;
 };
 
+// Bus 001 Device 005: ID 1a6e:089a Global Unichip Corp.  (DFU bootloader)
+// Bus 002 Device 007: ID 18d1:9302 Google Inc.           (flashed firmware)
+static const uint16_t kDfuVendorId = 0x1a6e;
+static const uint16_t kDfuProductId = 0x089a;
+
+// USB Device Firmware Upgrade 1.1 requests and states.
+static const uint8_t kDfuRequestOut = 0x21;  // Class, interface, host-to-device
+static const uint8_t kDfuRequestIn = 0xa1;   // Class, interface, device-to-host
+static const uint8_t kDfuDescriptorType = 0x21;
+static const uint16_t kDfuInterface = 0;
+static const uint16_t kDfuDefaultTransferSize = 64;
+static const unsigned int kDfuTimeoutMs = 5000;
+static const int kDfuReenumerateTimeoutMs = 10000;
+
+enum DfuRequest {
+  kDfuDnload = 1,
+  kDfuGetStatus = 3,
+  kDfuClrStatus = 4,
+};
+
+enum DfuState {
+  kDfuIdle = 2,
+  kDfuDnloadSync = 3,
+  kDfuDnBusy = 4,
+  kDfuDnloadIdle = 5,
+  kDfuManifestSync = 6,
+  kDfuManifest = 7,
+  kDfuManifestWaitReset = 8,
+  kDfuError = 10,
+};
+
+// Outcome of the last discovery that found the device in DFU mode.
+enum DfuResult {
+  kDfuNotFlashed = 0,
+  kDfuFlashed,            // Flashed device found again
+  kDfuNeedsPermission,    // Flashed, new device needs a user gesture to pick
+  kDfuFailed,
+};
+
+static std::vector<unsigned char> dfu_firmware;
+
+// Read by tflite.js through get_dfu_report().
+static struct {
+  int32_t result;
+  int32_t bytes;
+  int32_t time_ms;
+} dfu_report;
+
 static const struct libusb_version kVersion = {
   LIBUSB_MAJOR,
   LIBUSB_MINOR,
@@ -62,14 +113,28 @@ static const struct libusb_version kVersion = {
   "http://libusb.info"
 };
 
-static int js_request_device(struct libusb_device *dev) {
+// Finds the accelerator, either flashed or in DFU mode unless `flashed_only`.
+// Previously permitted devices are polled for up to `wait_ms` (e.g. while the
+// device re-enumerates after flashing) before asking the user, which is only
+// possible if `allow_prompt` and the call comes from a user gesture.
+static int js_request_device(struct libusb_device *dev, bool flashed_only,
+                             int wait_ms, bool allow_prompt) {
   return MAIN_THREAD_EM_ASM_INT({
     return Asyncify.handleAsync(async () => {
-      // Bus 001 Device 005: ID 1a6e:089a Global Unichip Corp.
-      // Bus 002 Device 007: ID 18d1:9302 Google Inc.
-      let options = {'filters': [{'vendorId': 0x18d1, 'productId': 0x9302}]};
-      let devices = await navigator.usb.getDevices();
-      if (!devices.length) {
+      let filters = [{'vendorId': 0x18d1, 'productId': 0x9302}];
+      if (!$1) filters.push({'vendorId': 0x1a6e, 'productId': 0x089a});
+      let options = {'filters': filters};
+      let matches = d => filters.some(f => f.vendorId == d.vendorId &&
+                                           f.productId == d.productId);
+
+      let deadline = Date.now() + $2;
+      let devices = (await navigator.usb.getDevices()).filter(matches);
+      while (!devices.length && Date.now() < deadline) {
+        await new Promise(resolve => setTimeout(resolve, 100));
+        devices = (await navigator.usb.getDevices()).filter(matches);
+      }
+
+      if (!devices.length && $3) {
         try {
           let device = await navigator.usb.requestDevice(options);
           devices = [device];
@@ -94,7 +159,7 @@ static int js_request_device(struct libusb_device *dev) {
       }
       return 0;
     });
-  }, dev);
+  }, dev, flashed_only, wait_ms, allow_prompt);
 }
 
 static int js_control_transfer(uint8_t bmRequestType, uint8_t bRequest,
@@ -118,28 +183,44 @@ static int js_control_transfer(uint8_t bmRequestType, uint8_t bRequest,
         'index': wIndex,
       };
 
-      let dir_in = (bmRequestType & 0x80) == 0x80;
-      if (dir_in) {
-        let result = await this.libusb_device.controlTransferIn(setup, wLength);
-        if (result.status != 'ok') {
-          console.error('controlTransferIn', result);
-          return 0;
-        }
+      // Timeout of 0 means unlimited, as in libusb.
+      let limit = transfer => !timeout ? transfer : Promise.race([transfer,
+          new Promise((_, reject) => setTimeout(
+              () => reject(new DOMException('Transfer timed out', 'TimeoutError')),
+              timeout))]);
 
-        let view = new Uint8Array(result.data.buffer);
-        writeArrayToMemory(view, data);
-        return result.data.buffer.byteLength;
-      } else {
-        let buffer = new Uint8Array(wLength);
-        for (let i = 0; i < wLength; ++i)
-          buffer[i] = getValue(data + i, 'i8');
-
-        let result = await this.libusb_device.controlTransferOut(setup, buffer);
-        if (result.status != 'ok') {
-          console.error('controlTransferOut', result);
-          return 0;
+      let dir_in = (bmRequestType & 0x80) == 0x80;
+      try {
+        if (dir_in) {
+          let result = await limit(this.libusb_device.controlTransferIn(setup, wLength));
+          if (result.status != 'ok') {
+            console.error('controlTransferIn', result);
+            return result.status == 'stall' ? -9 : -1;  // LIBUSB_ERROR_PIPE/IO
+          }
+
+          let view = new Uint8Array(result.data.buffer);
+          writeArrayToMemory(view, data);
+          return result.data.buffer.byteLength;
+        } else {
+          let buffer = new Uint8Array(wLength);
+          for (let i = 0; i < wLength; ++i)
+            buffer[i] = getValue(data + i, 'i8');
+
+          let result = await limit(this.libusb_device.controlTransferOut(setup, buffer));
+          if (result.status != 'ok') {
+            console.error('controlTransferOut', result);
+            return result.status == 'stall' ? -9 : -1;  // LIBUSB_ERROR_PIPE/IO
+          }
+          return result.bytesWritten;
         }
-        return result.bytesWritten;
+      } catch (error) {
+        // E.g. the device detached during DFU manifestation.
+        console.error('controlTransfer', error);
+        if (error.name == 'NotFoundError' || error.name == 'NetworkError')
+          return -4;  // LIBUSB_ERROR_NO_DEVICE
+        if (error.name == 'TimeoutError')
+          return -7;  // LIBUSB_ERROR_TIMEOUT
+        return -1;  // LIBUSB_ERROR_IO
       }
     });
   }, bmRequestType, bRequest, wValue, wIndex, data, wLength, timeout);
@@ -175,6 +256,196 @@ static void print_device(const struct libusb_device* dev) {
   print("    bNumConfigurations: ", dev->descriptor.bNumConfigurations);
 }
 
+static bool is_dfu_device(const struct libusb_device* dev) {
+  return dev->descriptor.idVendor == kDfuVendorId &&
+         dev->descriptor.idProduct == kDfuProductId;
+}
+
+// Returns wTransferSize from the DFU functional descriptor.
+static uint16_t dfu_transfer_size(libusb_device_handle* handle) {
+  unsigned char config[255];
+  int length = libusb_control_transfer(handle, LIBUSB_ENDPOINT_IN,
+      LIBUSB_REQUEST_GET_DESCRIPTOR, LIBUSB_DT_CONFIG << 8, 0, config,
+      sizeof(config), kDfuTimeoutMs);
+
+  for (int i = 0; i + 7 <= length && config[i] > 0; i += config[i]) {
+    if (config[i + 1] != kDfuDescriptorType) continue;
+    // A zero size would turn every block into an end-of-download request.
+    uint16_t size = config[i + 5] | (config[i + 6] << 8);
+    return size ? size : kDfuDefaultTransferSize;
+  }
+  return kDfuDefaultTransferSize;
+}
+
+// Returns bStatus (0 is OK) or a negative error.
+static int dfu_get_status(libusb_device_handle* handle, uint8_t* state,
+                          unsigned int* poll_timeout_ms) {
+  unsigned char status[6];
+  int length = libusb_control_transfer(handle, kDfuRequestIn, kDfuGetStatus, 0,
+                                       kDfuInterface, status, sizeof(status),
+                                       kDfuTimeoutMs);
+  if (length < 0) return length;
+  if (length != sizeof(status)) return LIBUSB_ERROR_IO;
+
+  *poll_timeout_ms = status[1] | (status[2] << 8) | (status[3] << 16);
+  *state = status[4];
+  return status[0];
+}
+
+// Waits until the device has processed the last DNLOAD block. Gives up after
+// kDfuTimeoutMs on top of the poll delays the device asked for.
+static bool dfu_wait_ready(libusb_device_handle* handle, bool manifest) {
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(kDfuTimeoutMs);
+  uint8_t state = 0;
+  while (true) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      print("DFU: timeout in state ", state);
+      return false;
+    }
+
+    unsigned int poll_timeout_ms;
+    int status = dfu_get_status(handle, &state, &poll_timeout_ms);
+    if (status == LIBUSB_ERROR_NO_DEVICE)
+      return manifest;  // Device may detach as soon as manifestation starts.
+    if (status != 0) return false;
+
+    switch (state) {
+      case kDfuIdle:
+      case kDfuDnloadIdle:
+      case kDfuManifestWaitReset:
+        return true;
+      case kDfuDnloadSync:
+      case kDfuDnBusy:
+      case kDfuManifestSync:
+      case kDfuManifest:
+        // Poll right away unless the device asks for a delay.
+        if (poll_timeout_ms) {
+          deadline += std::chrono::milliseconds(poll_timeout_ms);
+          emscripten_sleep(poll_timeout_ms);
+        }
+        break;
+      default:
+        print("DFU: unexpected state ", state);
+        return false;
+    }
+  }
+}
+
+static bool dfu_download(libusb_device_handle* handle,
+                         const std::vector<unsigned char>& firmware) {
+  uint8_t state;
+  unsigned int poll_timeout_ms;
+  if (dfu_get_status(handle, &state, &poll_timeout_ms) < 0) return false;
+  if (state == kDfuError)
+    libusb_control_transfer(handle, kDfuRequestOut, kDfuClrStatus, 0,
+                            kDfuInterface, nullptr, 0, kDfuTimeoutMs);
+
+  const size_t transfer_size = dfu_transfer_size(handle);
+  size_t block = 0;
+  for (size_t offset = 0; offset < firmware.size(); ++block) {
+    const size_t length = std::min(transfer_size, firmware.size() - offset);
+    unsigned char* data = const_cast<unsigned char*>(firmware.data()) + offset;
+    if (libusb_control_transfer(handle, kDfuRequestOut, kDfuDnload, block,
+                                kDfuInterface, data, length,
+                                kDfuTimeoutMs) != static_cast<int>(length))
+      return false;
+    if (!dfu_wait_ready(handle, /*manifest=*/false)) return false;
+    offset += length;
+  }
+
+  // Zero-length DNLOAD with the next block number ends the download and
+  // starts manifestation.
+  if (libusb_control_transfer(handle, kDfuRequestOut, kDfuDnload, block,
+                              kDfuInterface, nullptr, 0, kDfuTimeoutMs) != 0)
+    return false;
+  return dfu_wait_ready(handle, /*manifest=*/true);
+}
+
+// Fetches Module.firmwareUrl (firmware.bin next to the page by default)
+// unless the firmware was already set with set_dfu_firmware().
+static bool dfu_load_firmware() {
+  if (!dfu_firmware.empty()) return true;
+
+  return MAIN_THREAD_EM_ASM_INT({
+    return Asyncify.handleAsync(async () => {
+      let url = Module['firmwareUrl'] || 'firmware.bin';
+      try {
+        let response = await fetch(url);
+        if (!response.ok)
+          throw new Error(response.status + ' ' + response.statusText);
+
+        let firmware = new Uint8Array(await response.arrayBuffer());
+        let firmwarePtr = _malloc(firmware.length);
+        HEAPU8.set(firmware, firmwarePtr);
+        _set_dfu_firmware(firmwarePtr, firmware.length);
+        _free(firmwarePtr);
+        return 1;
+      } catch (error) {
+        console.error('firmware', url, error);
+        return 0;
+      }
+    });
+  });
+}
+
+// Flashes the firmware and resets the device so it re-enumerates with the
+// runtime vendor and product ids.
+static bool dfu_flash(struct libusb_device* dev) {
+  if (!dfu_load_firmware()) {
+    print("DFU: cannot load firmware");
+    dfu_report = {kDfuFailed, 0, 0};
+    return false;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  libusb_device_handle* handle;
+  if (libusb_open(dev, &handle) != LIBUSB_SUCCESS) {
+    dfu_report = {kDfuFailed, static_cast<int32_t>(dfu_firmware.size()), 0};
+    return false;
+  }
+
+  bool ok = libusb_set_configuration(handle, 1) == LIBUSB_SUCCESS &&
+            libusb_claim_interface(handle, kDfuInterface) == LIBUSB_SUCCESS &&
+            dfu_download(handle, dfu_firmware);
+  if (ok) libusb_reset_device(handle);
+  libusb_close(handle);
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start);
+  dfu_report = {ok ? kDfuFlashed : kDfuFailed,
+                static_cast<int32_t>(dfu_firmware.size()),
+                static_cast<int32_t>(elapsed.count())};
+  print(ok ? "DFU: flashed bytes: " : "DFU: failed, firmware bytes: ",
+        dfu_report.bytes);
+  print("DFU: time (ms): ", dfu_report.time_ms);
+  return ok;
+}
+
+// Finds the accelerator and flashes it first if it is still in DFU mode.
+// WebUSB treats the flashed device as a new one, so unless it was permitted
+// before it can only be picked on the next user gesture (kDfuNeedsPermission).
+static bool find_accelerator(struct libusb_device* dev) {
+  if (!js_request_device(dev, /*flashed_only=*/false, /*wait_ms=*/0,
+                         /*allow_prompt=*/true))
+    return false;
+
+  if (!is_dfu_device(dev)) {
+    if (dfu_report.result == kDfuNeedsPermission)
+      dfu_report.result = kDfuFlashed;
+    return true;
+  }
+
+  if (!dfu_flash(dev)) return false;
+  if (js_request_device(dev, /*flashed_only=*/true, kDfuReenumerateTimeoutMs,
+                        /*allow_prompt=*/false))
+    return true;
+
+  print("DFU: flashed device is not permitted yet");
+  dfu_report.result = kDfuNeedsPermission;
+  return false;
+}
+
 extern "C" {
 
 int libusb_init(libusb_context **ctx) {
@@ -360,7 +631,12 @@ void LIBUSB_CALL libusb_close(libusb_device_handle *dev_handle) {
 
   MAIN_THREAD_EM_ASM_INT({
     Asyncify.handleAsync(async () => {
-      return await this.libusb_device.close();
+      try {
+        return await this.libusb_device.close();
+      } catch (error) {
+        // Device is gone already, e.g. after firmware download.
+        console.error('close', error);
+      }
     });
   });
 
@@ -378,7 +654,7 @@ ssize_t LIBUSB_CALL libusb_get_device_list(libusb_context *ctx, libusb_device **
   auto* dev = &ctx->dev;
   dev->ctx = ctx;
 
-  if (js_request_device(dev)) {
+  if (find_accelerator(dev)) {
     print_device(dev);
     *list = new libusb_device*[]{dev, nullptr};
     return 1;
@@ -419,8 +695,20 @@ uint8_t LIBUSB_CALL libusb_get_bus_number(libusb_device *dev) {
 
 int LIBUSB_CALL libusb_set_configuration(libusb_device_handle *dev,
                                          int configuration) {
-  LIBUSB_LOG("libusb_set_configuration [NOT IMPLEMENTED]");
-  return 0;
+  LIBUSB_LOG("libusb_set_configuration: configuration=%d", configuration);
+  return MAIN_THREAD_EM_ASM_INT({
+    return Asyncify.handleAsync(async () => {
+      try {
+        let current = this.libusb_device.configuration;
+        if (!current || current.configurationValue != $0)
+          await this.libusb_device.selectConfiguration($0);
+        return 0;  // LIBUSB_SUCCESS
+      } catch (error) {
+        console.error('selectConfiguration:', error);
+        return -1;  // LIBUSB_ERROR_IO
+      }
+    });
+  }, configuration);
 }
 
 int LIBUSB_CALL libusb_claim_interface(libusb_device_handle *dev,
@@ -479,6 +767,25 @@ void set_transfer_completed(struct libusb_transfer* transfer, int actual_length)
   ctx->completed_transfers.Push(transfer);
 }
 
+EMSCRIPTEN_KEEPALIVE
+void set_dfu_firmware(const unsigned char* data, size_t size) {
+  dfu_firmware.assign(data, data + size);
+}
+
+// [0] DfuResult, [1] firmware bytes, [2] flash time in ms.
+EMSCRIPTEN_KEEPALIVE
+const int32_t* get_dfu_report() {
+  return &dfu_report.result;
+}
+
+// Runs device discovery (flashing included) without creating an interpreter,
+// e.g. to measure flash time. Returns 1 if a flashed device is available.
+EMSCRIPTEN_KEEPALIVE
+int find_device() {
+  static libusb_device dev;
+  return find_accelerator(&dev);
+}
+
 EMSCRIPTEN_KEEPALIVE
 void fill_device(struct libusb_device* dev,
     uint16_t bcdUSB,
@@ -0,0 +1,115 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef TFLITE_TASK_POOL_H_
+#define TFLITE_TASK_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own task deque. Workers take
+// tasks from the back of their own deque and steal from the front of others.
+class TaskPool {
+ public:
+  explicit TaskPool(size_t num_threads) {
+    for (size_t i = 0; i < num_threads; ++i)
+      workers_.push_back(std::make_unique<Worker>());
+    for (size_t i = 0; i < num_threads; ++i)
+      threads_.emplace_back([this, i]() { Run(i); });
+  }
+
+  ~TaskPool() {
+    {
+      std::lock_guard<std::mutex> lock(m_);
+      exit_ = true;
+    }
+    cv_.notify_all();
+    for (auto& thread : threads_) thread.join();
+  }
+
+  void Submit(std::function<void()> task) {
+    size_t index = current_pool_ == this
+        ? current_worker_ : next_worker_++ % workers_.size();
+    {
+      auto& worker = *workers_[index];
+      std::lock_guard<std::mutex> lock(worker.m);
+      worker.tasks.push_back(std::move(task));
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_);
+      ++pending_;
+    }
+    cv_.notify_one();
+  }
+
+ private:
+  struct Worker {
+    std::mutex m;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  void Run(size_t index) {
+    current_pool_ = this;
+    current_worker_ = index;
+    while (true) {
+      {
+        // Reserve one task; it is guaranteed to be in some deque.
+        std::unique_lock<std::mutex> lock(m_);
+        cv_.wait(lock, [this] { return exit_ || pending_ > 0; });
+        if (exit_) break;
+        --pending_;
+      }
+      Take(index)();
+    }
+  }
+
+  std::function<void()> Take(size_t index) {
+    while (true) {
+      for (size_t i = 0; i < workers_.size(); ++i) {
+        auto& worker = *workers_[(index + i) % workers_.size()];
+        std::lock_guard<std::mutex> lock(worker.m);
+        if (worker.tasks.empty()) continue;
+
+        std::function<void()> task;
+        if (i == 0) {
+          task = std::move(worker.tasks.back());
+          worker.tasks.pop_back();
+        } else {
+          task = std::move(worker.tasks.front());
+          worker.tasks.pop_front();
+        }
+        return task;
+      }
+    }
+  }
+
+  static inline thread_local const TaskPool* current_pool_ = nullptr;
+  static inline thread_local size_t current_worker_ = SIZE_MAX;
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  std::atomic<size_t> next_worker_{0};
+  std::mutex m_;
+  std::condition_variable cv_;
+  size_t pending_ = 0;
+  bool exit_ = false;
+};
+
+#endif  // TFLITE_TASK_POOL_H_
@@ -0,0 +1,134 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef TFLITE_TRACKER_H_
+#define TFLITE_TRACKER_H_
+
+#include <algorithm>
+#include <tuple>
+#include <vector>
+
+struct Box {
+  float x, y, width, height;
+};
+
+struct Detection {
+  Box box;
+  int class_id;
+  float score;
+};
+
+struct Track {
+  int id;
+  Box box;
+  float vx, vy;  // Center velocity per frame.
+  int class_id;
+  float score;
+  int misses;    // Consecutive detection frames without a match.
+  int frames;    // Frames since the last matched detection.
+};
+
+inline float IoU(const Box& a, const Box& b) {
+  const float w = std::min(a.x + a.width, b.x + b.width) - std::max(a.x, b.x);
+  const float h = std::min(a.y + a.height, b.y + b.height) - std::max(a.y, b.y);
+  if (w <= 0 || h <= 0) return 0.0f;
+  const float intersection = w * h;
+  return intersection /
+      (a.width * a.height + b.width * b.height - intersection);
+}
+
+// Greedy IoU association of detections to tracks, with an alpha-beta filter
+// (steady-state constant velocity Kalman filter) on box centers so tracks can
+// be propagated over frames where the detector is skipped.
+class Tracker {
+ public:
+  static constexpr float kAlpha = 0.7f;   // Position gain.
+  static constexpr float kBeta = 0.3f;    // Velocity gain.
+  static constexpr int kMaxMisses = 2;
+
+  void Reset() {
+    tracks_.clear();
+  }
+
+  // Moves every track one frame ahead.
+  void Predict() {
+    for (auto& track : tracks_) {
+      track.box.x += track.vx;
+      track.box.y += track.vy;
+      ++track.frames;
+    }
+  }
+
+  // Corrects predicted tracks with the detections of the current frame.
+  void Update(const std::vector<Detection>& detections, float iou_threshold) {
+    std::vector<std::tuple<float, size_t, size_t>> pairs;
+    for (size_t t = 0; t < tracks_.size(); ++t) {
+      for (size_t d = 0; d < detections.size(); ++d) {
+        if (tracks_[t].class_id != detections[d].class_id) continue;
+        const float iou = IoU(tracks_[t].box, detections[d].box);
+        if (iou >= iou_threshold) pairs.emplace_back(iou, t, d);
+      }
+    }
+    std::sort(pairs.begin(), pairs.end(),
+              [](const auto& a, const auto& b) { return a > b; });
+
+    std::vector<bool> track_matched(tracks_.size(), false);
+    std::vector<bool> detection_matched(detections.size(), false);
+    for (const auto& [iou, t, d] : pairs) {
+      if (track_matched[t] || detection_matched[d]) continue;
+      track_matched[t] = detection_matched[d] = true;
+      Correct(&tracks_[t], detections[d]);
+    }
+
+    std::vector<Track> tracks;
+    for (size_t t = 0; t < tracks_.size(); ++t) {
+      if (!track_matched[t] && ++tracks_[t].misses > kMaxMisses) continue;
+      tracks.push_back(tracks_[t]);
+    }
+    for (size_t d = 0; d < detections.size(); ++d) {
+      if (detection_matched[d]) continue;
+      const auto& detection = detections[d];
+      tracks.push_back({next_id_++, detection.box, 0.0f, 0.0f,
+                        detection.class_id, detection.score, 0, 0});
+    }
+    tracks_ = std::move(tracks);
+  }
+
+  const std::vector<Track>& tracks() const { return tracks_; }
+
+ private:
+  static void Correct(Track* track, const Detection& detection) {
+    const Box& m = detection.box;
+    const Box& b = track->box;
+    const float cx = b.x + b.width / 2;
+    const float cy = b.y + b.height / 2;
+    const float rx = (m.x + m.width / 2) - cx;
+    const float ry = (m.y + m.height / 2) - cy;
+    const float width = b.width + kAlpha * (m.width - b.width);
+    const float height = b.height + kAlpha * (m.height - b.height);
+    const float frames = std::max(track->frames, 1);
+
+    track->box = {cx + kAlpha * rx - width / 2, cy + kAlpha * ry - height / 2,
+                  width, height};
+    track->vx += kBeta * rx / frames;
+    track->vy += kBeta * ry / frames;
+    track->score = detection.score;
+    track->misses = 0;
+    track->frames = 0;
+  }
+
+  std::vector<Track> tracks_;
+  int next_id_ = 0;
+};
+
+#endif  // TFLITE_TRACKER_H_